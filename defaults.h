@@ -53,3 +53,21 @@ const bool verbose = false;
 
 /* default to non-smooth colouring */
 const bool smooth = false;
+
+/* default to colouring by raw iteration count rather than histogram equalisation */
+const bool histogram = false;
+
+/* file to periodically write render stats to, NULL to disable */
+const char * const statsfile = NULL;
+
+/* number of seconds between stats updates */
+const double stats_interval = 1.0;
+
+/* default to not printing a progress line */
+const bool progress = false;
+
+/* default to writing rows with buffered stdio */
+const enum Engine engine = Stdio;
+
+/* default to writing through the page cache */
+const bool direct = false;
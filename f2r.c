@@ -1,6 +1,9 @@
 #include "cmap.h"
 #include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <linux/io_uring.h>
 #include <math.h>
 #include <pthread.h>
 #include <stdarg.h>
@@ -10,16 +13,45 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
 
 /* little macro for printing booleans as strings */
 #define BOOL2STR(x) ((x) ? "true" : "false")
 
+/* size of a cache line, used to keep per-thread counters apart */
+#define CACHE_LINE 64
+
+/* size and number of the buffers used by the asynchronous writer engines */
+#define WRITE_CHUNK (4 << 20)
+#define WRITE_BUFFERS 8
+
+/* alignment of buffers, offsets and lengths required by O_DIRECT */
+#define DIRECT_ALIGN 4096
+
+/* upper bound on the memory used by the histograms for histogram colouring */
+#define HISTOGRAM_MAX_BYTES ((size_t)1 << 30)
+
 /* enum representing the different types of fractals available */
 enum Fractal {
 	Julia,
 	Mandelbrot,
 };
 
+/* enum representing the different ways of writing the image out */
+enum Engine {
+	// buffered fwrite of each row
+	Stdio,
+	// batched asynchronous writes through io_uring, falling back to Pwritev
+	IoUring,
+	// batched pwritev calls from a helper thread
+	Pwritev,
+};
+
 typedef struct {
 	double x;
 	double y;
@@ -39,6 +71,7 @@ struct settings {
 	struct colourmap* colourmap;
 	bool verbose;
 	bool smooth;
+	bool histogram;
 };
 
 /* exclusively those settings controlled by the user */
@@ -55,6 +88,12 @@ struct user_options {
 	const char* outfile;
 	bool verbose;
 	bool smooth;
+	bool histogram;
+	const char* statsfile;
+	double stats_interval;
+	bool progress;
+	enum Engine engine;
+	bool direct;
 };
 
 enum row_write_state {
@@ -66,6 +105,36 @@ enum row_write_state {
 	Written,
 };
 
+// The state shared between the threads for histogram equalised colouring
+struct histogram {
+	// the unlinked file backing iters, so large images are paged out rather than held in memory.
+	// It is created in $TMPDIR if set, otherwise next to the outfile, as /tmp is often a tmpfs
+	int backing;
+	// the escape iteration count of every pixel, filled in by the first pass
+	uint32_t* iters;
+	// nhists histograms of settings->iterations bins, thread t counts into t % nhists
+	// and they are then merged into the first. There is one per thread unless that
+	// would exceed HISTOGRAM_MAX_BYTES, in which case threads share them
+	_Atomic(uint64_t)* bins;
+	// the total of each thread's slice of the merged histogram, used by the prefix sum
+	uint64_t* slice_totals;
+	uint32_t nthreads;
+	uint32_t nhists;
+	_Atomic(uint32_t) next_row;
+	pthread_barrier_t barrier;
+};
+
+// Counters updated by a single renderer thread and read by the stats thread,
+// each on its own cache line so the renderers never contend for them
+struct thread_stats {
+	_Alignas(CACHE_LINE) _Atomic(uint64_t) rows;
+	// rows whose iterations have been counted by the first pass of histogram colouring
+	_Atomic(uint64_t) counted_rows;
+	_Atomic(uint64_t) iterations;
+	// time spent rendering rows, in nanoseconds
+	_Atomic(uint64_t) busy_ns;
+};
+
 // The state needed to render rows
 struct thread_arg {
 	_Atomic(Pixel*)* rows;
@@ -73,11 +142,26 @@ struct thread_arg {
 	_Atomic(uint32_t)* const next_row;
 	_Atomic(uint32_t)* const rows_to_write;
 	const struct settings* const settings;
+	// NULL unless rendering with histogram equalised colouring
+	struct histogram* const histogram;
+	// one per renderer thread, indexed by renderer_arg.id
+	struct thread_stats* const stats;
+};
+
+// The per-thread argument passed to each renderer thread
+struct renderer_arg {
+	uint32_t id;
+	const struct thread_arg* targ;
 };
 
 struct writer_arg {
 	// the file to write the image data to
 	FILE* outfile;
+	// the file descriptor used by the asynchronous engines
+	int fd;
+	enum Engine engine;
+	// whether fd was opened with O_DIRECT
+	bool direct;
 	// whether we need to write out lines in order (writing to stdout)
 	bool in_order_write;
 
@@ -85,6 +169,71 @@ struct writer_arg {
 	struct thread_arg* const targ;
 };
 
+struct stats_arg {
+	// the file to periodically rewrite with the latest stats, or NULL
+	const char* statsfile;
+	double interval;
+	// whether to print a progress line to stderr
+	bool progress;
+	uint32_t nthreads;
+	// taken by main before the renderers start, so busy time is measured against the same span
+	struct timespec start;
+	// set by main once the image has been written
+	_Atomic(bool) done;
+
+	const struct thread_arg* targ;
+};
+
+// A chunk of the output file being filled or written by an asynchronous engine
+struct write_buffer {
+	char* data;
+	struct iovec iov;
+	off_t offset;
+	bool busy;
+};
+
+// The mappings of an io_uring instance's rings
+struct uring {
+	int fd;
+	unsigned* sq_tail;
+	unsigned* sq_mask;
+	unsigned* sq_array;
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	unsigned* cq_mask;
+	struct io_uring_sqe* sqes;
+	struct io_uring_cqe* cqes;
+	void* sq_ptr;
+	size_t sq_len;
+	void* cq_ptr;
+	size_t cq_len;
+	size_t sqes_len;
+};
+
+// The state of an asynchronous writer engine
+struct write_engine {
+	enum Engine kind;
+	int fd;
+	struct write_buffer buffers[WRITE_BUFFERS];
+
+	// time spent with writes in progress, in nanoseconds
+	uint64_t io_ns;
+
+	// used by IoUring, io_ns accumulates while inflight is non-zero
+	struct uring ring;
+	uint32_t inflight;
+	struct timespec busy_start;
+
+	// used by Pwritev, the helper thread writes the queued buffers in order
+	pthread_t helper;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	uint32_t queue[WRITE_BUFFERS];
+	uint32_t queue_head;
+	uint32_t queue_len;
+	bool stop;
+};
+
 struct ff_header {
 	char magic[8];
 	uint32_t width;
@@ -95,7 +244,25 @@ static void parse_options(int, char**, struct user_options*);
 static void usage(const char*);
 static void* rowrenderer(void*);
 static void* writer_thread(void*);
-static void colour(const uint32_t, const uint32_t, Pixel*, const struct settings*);
+static void* async_writer_thread(void*);
+static void engine_init(struct write_engine*, const enum Engine, const int);
+static uint32_t engine_acquire(struct write_engine*);
+static void engine_submit(struct write_engine*, const uint32_t);
+static void engine_drain(struct write_engine*);
+static void engine_poll(struct write_engine*);
+static bool uring_init(struct uring*, const unsigned);
+static void uring_reap(struct write_engine*, const bool);
+static void* pwritev_helper(void*);
+static void* stats_thread(void*);
+static void write_stats(const struct stats_arg*);
+static uint64_t elapsed_ns(const struct timespec*);
+static void record_row(struct thread_stats*, _Atomic(uint64_t)*, const uint64_t, const struct timespec*);
+static void histogram_init(struct histogram*, const struct settings*, const uint32_t, const char*);
+static void histogram_free(struct histogram*, const struct settings*);
+static void histogram_pass(const struct renderer_arg*);
+static size_t colour(const uint32_t, const uint32_t, Pixel*, const struct settings*);
+static uint32_t iterate(const uint32_t, const uint32_t, const struct settings*);
+static void colour_histogram(const uint32_t, Pixel*, const struct histogram*, const struct settings*);
 static void die(const char*, ...);
 static uint32_t min(const uint32_t, const uint32_t);
 
@@ -123,6 +290,12 @@ int main(int argc, char* argv[]) {
 		.outfile = outfile,
 		.verbose = verbose,
 		.smooth = smooth,
+		.histogram = histogram,
+		.statsfile = statsfile,
+		.stats_interval = stats_interval,
+		.progress = progress,
+		.engine = engine,
+		.direct = direct,
 	};
 
 	/* Parse the command line options */
@@ -142,12 +315,46 @@ int main(int argc, char* argv[]) {
 	};
 
 	/* open the file and write the header */
-	FILE* fp;
+	FILE* fp = NULL;
+	int fd = -1;
 	bool in_order_write = false;
 	if (strlen(uo.outfile) == 1 && uo.outfile[0] == '-') {
 		/* write to stdout */
 		fp = stdout;
 		in_order_write = true;
+
+		/* the asynchronous engines need a regular file to write into */
+		if (uo.engine != Stdio) {
+			fputs("Asynchronous write engines need a regular outfile, using stdio.\n", stderr);
+			uo.engine = Stdio;
+		}
+	} else if (uo.engine != Stdio) {
+		/* open the specified output file for the asynchronous engines */
+		fd = open(uo.outfile, O_WRONLY | O_CREAT | O_TRUNC | (uo.direct ? O_DIRECT : 0), 0666);
+
+		/* filesystems without O_DIRECT support reject it with EINVAL */
+		if (fd < 0 && uo.direct && errno == EINVAL) {
+			fprintf(stderr, "O_DIRECT is not supported for outfile: \"%s\", writing through the page cache.\n", uo.outfile);
+			uo.direct = false;
+			fd = open(uo.outfile, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		}
+
+		if (fd < 0)
+			die("Failed to open outfile: \"%s\": %s, exiting.\n", uo.outfile, strerror(errno));
+
+		/* positioned writes need a regular file, anything else (a fifo, /dev/stdout)
+		 * is written in order with stdio through the already open descriptor */
+		struct stat st;
+		if (fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+			fputs("Asynchronous write engines need a regular outfile, using stdio.\n", stderr);
+			uo.engine = Stdio;
+			uo.direct = false;
+			in_order_write = true;
+
+			if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT) || (fp = fdopen(fd, "w")) == NULL)
+				die("Failed to open outfile: \"%s\", exiting.\n", uo.outfile);
+			fd = -1;
+		}
 	} else {
 		/* open the specified output file */
 		fp = fopen(uo.outfile, "w");
@@ -169,6 +376,12 @@ int main(int argc, char* argv[]) {
 		fprintf(stderr, "\tcolourmap: %s\n", uo.mapfile);
 		fprintf(stderr, "\tverbose: %s\n", BOOL2STR(uo.verbose));
 		fprintf(stderr, "\tsmooth: %s\n", BOOL2STR(uo.smooth));
+		fprintf(stderr, "\thistogram: %s\n", BOOL2STR(uo.histogram));
+		fprintf(stderr, "\tstatsfile: %s\n", uo.statsfile ? uo.statsfile : "none");
+		fprintf(stderr, "\tstats_interval: %f\n", uo.stats_interval);
+		fprintf(stderr, "\tprogress: %s\n", BOOL2STR(uo.progress));
+		fprintf(stderr, "\tengine: %d\n", uo.engine);
+		fprintf(stderr, "\tdirect: %s\n", BOOL2STR(uo.direct));
 	}
 
 	/* setup the actual settings passed to the renderer */
@@ -183,6 +396,7 @@ int main(int argc, char* argv[]) {
 		.colourmap = read_map(uo.mapfile),
 		.verbose = uo.verbose,
 		.smooth = uo.smooth,
+		.histogram = uo.histogram,
 	};
 
 	/********************************
@@ -197,13 +411,33 @@ int main(int argc, char* argv[]) {
 	/* setup for starting the threads */
 	_Atomic(uint32_t) next_row = ATOMIC_VAR_INIT(0);
 	_Atomic(uint32_t) rows_to_write = ATOMIC_VAR_INIT(0);
-	pthread_t tids[uo.threads], writer_tid;
+	pthread_t tids[uo.threads], writer_tid, stats_tid;
+	const bool collect_stats = uo.statsfile != NULL || uo.progress;
+	struct renderer_arg rargs[uo.threads];
+
+	/* set up the iteration buffer and histograms for histogram colouring */
+	struct histogram hist;
+	if (settings.histogram) {
+		histogram_init(&hist, &settings, uo.threads, uo.outfile);
+	}
 
 	/* set up the thread arguments */
 	/* both free'd by writer_thread on exit */
 	_Atomic(Pixel*)* rows = calloc(settings.height, sizeof(Pixel*));
 	_Atomic(enum row_write_state)* row_states = calloc(settings.height, sizeof(_Atomic(enum row_write_state)));
 
+	/* per-thread counters, aligned so no two threads share a cache line */
+	const size_t stats_size = uo.threads * sizeof(struct thread_stats);
+	struct thread_stats* stats = aligned_alloc(CACHE_LINE, stats_size ? stats_size : sizeof(struct thread_stats));
+	if (stats == NULL)
+		die("Failed to allocate the thread stats\n");
+	for (uint32_t i = 0; i < uo.threads; i++) {
+		atomic_init(&stats[i].rows, 0);
+		atomic_init(&stats[i].counted_rows, 0);
+		atomic_init(&stats[i].iterations, 0);
+		atomic_init(&stats[i].busy_ns, 0);
+	}
+
 	// setup the thread argument
 	struct thread_arg targ = {
 		.rows = rows,
@@ -211,17 +445,35 @@ int main(int argc, char* argv[]) {
 		.next_row = &next_row,
 		.rows_to_write = &rows_to_write,
 		.settings = &settings,
+		.histogram = settings.histogram ? &hist : NULL,
+		.stats = stats,
+	};
+
+	struct stats_arg sarg = {
+		.statsfile = uo.statsfile,
+		.interval = uo.stats_interval,
+		.progress = uo.progress,
+		.nthreads = uo.threads,
+		.done = ATOMIC_VAR_INIT(false),
+		.targ = &targ,
 	};
 
 	struct writer_arg warg = {
 		.outfile = fp,
+		.fd = fd,
+		.engine = uo.engine,
+		.direct = uo.direct,
 		.in_order_write = in_order_write,
 		.targ = &targ,
 	};
 
+	/* start timing the render for the stats before any renderer can record a row */
+	clock_gettime(CLOCK_MONOTONIC, &sarg.start);
+
 	/* start the renderer threads */
 	for (uint32_t i = 0; i < uo.threads; i++) {
-		if (pthread_create(&tids[i], NULL, rowrenderer, &targ)) {
+		rargs[i] = (struct renderer_arg){ .id = i, .targ = &targ };
+		if (pthread_create(&tids[i], NULL, rowrenderer, &rargs[i])) {
 			die("error creating thread %d\n", i);
 		} else if (settings.verbose) {
 			fprintf(stderr, "[thread]\t%d\tcreated\n", i);
@@ -229,12 +481,21 @@ int main(int argc, char* argv[]) {
 	}
 
 	/* Start the writer thread */
-	if (pthread_create(&writer_tid, NULL, writer_thread, &warg)) {
+	if (pthread_create(&writer_tid, NULL, uo.engine == Stdio ? writer_thread : async_writer_thread, &warg)) {
 		die("Error creating writer thread\n");
 	} else if (settings.verbose) {
 		fputs("[writer]\t\tcreated\n", stderr);
 	}
 
+	/* Start the stats thread */
+	if (collect_stats) {
+		if (pthread_create(&stats_tid, NULL, stats_thread, &sarg)) {
+			die("Error creating stats thread\n");
+		} else if (settings.verbose) {
+			fputs("[stats]\t\tcreated\n", stderr);
+		}
+	}
+
 	/* join render threads */
 	for (uint32_t i = 0; i < uo.threads; i++) {
 		if (pthread_join(tids[i], NULL)) {
@@ -260,13 +521,34 @@ int main(int argc, char* argv[]) {
 		fputs("[writer]\t\tjoined\n", stderr);
 	}
 
+	/* stop the stats thread, it writes out the final stats on exit */
+	if (collect_stats) {
+		atomic_store(&sarg.done, true);
+		if (pthread_join(stats_tid, NULL)) {
+			die("Failed to join stats thread\n");
+		} else if (settings.verbose) {
+			fputs("[stats]\t\tjoined\n", stderr);
+		}
+	}
+	free(stats);
+
 	if (settings.verbose)
 		fputs("[main]\t\tfreeing colourmap\n", stderr);
 	free_cmap(settings.colourmap);
 
+	if (settings.histogram) {
+		if (settings.verbose)
+			fputs("[main]\t\tfreeing histogram\n", stderr);
+		histogram_free(&hist, &settings);
+	}
+
 	if (settings.verbose)
 		fputs("[main]\t\tclosing file\n", stderr);
-	fclose(fp);
+	if (fp != NULL) {
+		fclose(fp);
+	} else {
+		close(fd);
+	}
 
 	return 0;
 }
@@ -276,6 +558,11 @@ static void parse_options(int argc, char** argv, struct user_options* uo) {
 		/* put the long-only options first */
 		{ "image_centre", required_argument, NULL, 0 },
 		{ "julia_centre", required_argument, NULL, 0 },
+		{ "statsfile", required_argument, NULL, 0 },
+		{ "stats_interval", required_argument, NULL, 0 },
+		{ "progress", no_argument, NULL, 0 },
+		{ "engine", required_argument, NULL, 0 },
+		{ "direct", no_argument, NULL, 0 },
 
 		/* now long and short args */
 		{ "fractal_type", required_argument, NULL, 'f' },
@@ -289,6 +576,7 @@ static void parse_options(int argc, char** argv, struct user_options* uo) {
 		{ "help", no_argument, NULL, 'h' },
 		{ "verbose", no_argument, NULL, 'v' },
 		{ "smooth", no_argument, NULL, 's' },
+		{ "histogram", no_argument, NULL, 'e' },
 		{ NULL, 0, NULL, 0 },
 	};
 
@@ -296,7 +584,7 @@ static void parse_options(int argc, char** argv, struct user_options* uo) {
 	const char* program_name = argv[0];
 	int option_index = 0, c;
 
-	while ((c = getopt_long(argc, argv, "f:t:m:r:w:i:x:o:hsv", long_options, &option_index)) != -1) {
+	while ((c = getopt_long(argc, argv, "f:t:m:r:w:i:x:o:hsve", long_options, &option_index)) != -1) {
 		switch (c) {
 		case 0: /* long option */
 			switch (option_index) {
@@ -310,6 +598,36 @@ static void parse_options(int argc, char** argv, struct user_options* uo) {
 					fprintf(stderr, "Failed to parse julia_centre: %s\n", optarg);
 				}
 				break;
+			case 2:
+				uo->statsfile = optarg;
+				break;
+			case 3: {
+				/* only replace the default with a valid, positive interval */
+				double interval;
+				if (sscanf(optarg, "%lf", &interval) != 1 || !(interval > 0 && isfinite(interval))) {
+					fprintf(stderr, "Failed to parse stats_interval: %s\n", optarg);
+				} else {
+					uo->stats_interval = interval;
+				}
+				break;
+			}
+			case 4:
+				uo->progress = true;
+				break;
+			case 5:
+				if (strcasecmp("stdio", optarg) == 0) {
+					uo->engine = Stdio;
+				} else if (strcasecmp("io_uring", optarg) == 0) {
+					uo->engine = IoUring;
+				} else if (strcasecmp("pwritev", optarg) == 0) {
+					uo->engine = Pwritev;
+				} else {
+					fprintf(stderr, "Unsupported engine: %s\n", optarg);
+				}
+				break;
+			case 6:
+				uo->direct = true;
+				break;
 			}
 			break;
 		case 'f':
@@ -363,6 +681,9 @@ static void parse_options(int argc, char** argv, struct user_options* uo) {
 		case 's':
 			uo->smooth = true;
 			break;
+		case 'e':
+			uo->histogram = true;
+			break;
 		}
 	}
 }
@@ -382,18 +703,35 @@ static void usage(const char* program_name) {
 	puts("  -o, --outfile        file to save the resulting image to. default: out.ff");
 	puts("  -v, --verbose        enables verbose output");
 	puts("  -s, --smooth         enables smooth colouring at a performance penalty");
+	puts("  -e, --histogram      colour by histogram equalised iteration counts, overrides --smooth");
+	puts("                       NOTE: uses a temporary file in $TMPDIR, or the outfile's directory if unset");
 	puts("");
 	puts("      --image_centre   centre of the image's bounding box. default: 0.0,0.0");
 	puts("                       NOTE: takes 2 doubles x,y with NO SPACE between");
 	puts("      --julia_centre   value of C in the calculation of the julia set iterations. default: -0.8,0.156");
 	puts("                       NOTE: takes 2 doubles x,y with NO SPACE between");
+	puts("      --statsfile      file to periodically rewrite with JSON render stats. default: none");
+	puts("      --stats_interval seconds between stats updates. default: 1.0");
+	puts("      --progress       print a live progress line to stderr");
+	puts("      --engine         how to write the image (stdio|io_uring|pwritev). default: stdio");
+	puts("                       NOTE: io_uring falls back to pwritev when unavailable");
+	puts("      --direct         open the outfile with O_DIRECT, only used by io_uring and pwritev");
 }
 
 static void* rowrenderer(void* varg) {
 	/* colours the y'th row of the image.  */
-	const struct thread_arg* const arg = (struct thread_arg*)varg;
+	const struct renderer_arg* const rarg = (struct renderer_arg*)varg;
+	const struct thread_arg* const arg = rarg->targ;
 	const struct settings* const settings = arg->settings;
 
+	struct thread_stats* const stats = &arg->stats[rarg->id];
+	struct timespec row_start;
+
+	/* histogram colouring needs every iteration count before any pixel can be coloured */
+	if (settings->histogram) {
+		histogram_pass(rarg);
+	}
+
 	_Atomic(Pixel*)* rows = arg->rows;
 
 	uint32_t curr_row;
@@ -402,12 +740,22 @@ static void* rowrenderer(void* varg) {
 	curr_row = atomic_fetch_add(arg->next_row, 1);
 
 	while (curr_row < settings->height) {
+		clock_gettime(CLOCK_MONOTONIC, &row_start);
+		uint64_t row_iterations = 0;
+
 		/* Allocate the space for the current row */
 		Pixel* row = malloc(settings->width * sizeof(Pixel));
 
 		/* Colour each pixel in the row */
-		for (uint32_t x = 0; x < settings->width; x++) {
-			colour(x, curr_row, &row[x], settings);
+		if (settings->histogram) {
+			const uint32_t* iters = &arg->histogram->iters[(size_t)curr_row * settings->width];
+			for (uint32_t x = 0; x < settings->width; x++) {
+				colour_histogram(iters[x], &row[x], arg->histogram, settings);
+			}
+		} else {
+			for (uint32_t x = 0; x < settings->width; x++) {
+				row_iterations += colour(x, curr_row, &row[x], settings);
+			}
 		}
 
 		/* write the pointer to the row out to be written to disk */
@@ -419,6 +767,8 @@ static void* rowrenderer(void* varg) {
 		/* tell the writer thread that there is one more row ready to be written */
 		atomic_fetch_add(arg->rows_to_write, 1);
 
+		record_row(stats, &stats->rows, row_iterations, &row_start);
+
 		/* Get the next row of the image to render */
 		curr_row = atomic_fetch_add(arg->next_row, 1);
 	}
@@ -443,6 +793,10 @@ static void* writer_thread(void* varg) {
 	uint32_t min_unwritten_row = 0;
 	uint32_t row_to_write;
 	_Atomic(Pixel*)* rows = targ->rows;
+
+	/* time spent in stdio, for comparison with the asynchronous engines */
+	uint64_t io_ns = 0;
+	struct timespec write_start;
 	Pixel* row;
 
 	while (min_unwritten_row < settings->height) {
@@ -503,6 +857,8 @@ static void* writer_thread(void* varg) {
 		if (row == NULL) //die("It should be impossible to reach here with a row of NULL");
 			continue;
 
+		clock_gettime(CLOCK_MONOTONIC, &write_start);
+
 		/* if writing out of order - seek to the right place in the file first */
 		if (!arg->in_order_write) {
 			fseek(arg->outfile, sizeof(struct ff_header) + row_to_write * (settings->width * sizeof(Pixel)), SEEK_SET);
@@ -510,6 +866,7 @@ static void* writer_thread(void* varg) {
 
 		/* write out the row */
 		fwrite(row, sizeof(Pixel), settings->width, arg->outfile);
+		io_ns += elapsed_ns(&write_start);
 
 		/* set the row as Written */
 		atomic_store(&targ->row_states[row_to_write], Written);
@@ -526,6 +883,17 @@ static void* writer_thread(void* varg) {
 		}
 	}
 
+	if (settings->verbose) {
+		/* include flushing what stdio has buffered */
+		clock_gettime(CLOCK_MONOTONIC, &write_start);
+		fflush(arg->outfile);
+		io_ns += elapsed_ns(&write_start);
+
+		const double io_time = io_ns / 1e9;
+		const double size = (sizeof(struct ff_header) + (double)settings->height * settings->width * sizeof(Pixel)) / 1e6;
+		fprintf(stderr, "[writer]\t\twrote %.1f MB in %.3fs of I/O at %.1f MB/s\n", size, io_time, io_time > 0 ? size / io_time : 0);
+	}
+
 	/* free the space used to store the pointers to the rows */
 	free(rows);
 	free(targ->row_states);
@@ -533,15 +901,608 @@ static void* writer_thread(void* varg) {
 	return NULL;
 }
 
+static void histogram_init(struct histogram* hist, const struct settings* settings, const uint32_t nthreads, const char* outfile) {
+	/* a single histogram must fit in HISTOGRAM_MAX_BYTES, this also keeps
+	 * the iteration counts small enough to be stored in 32 bits */
+	const size_t max_iterations = HISTOGRAM_MAX_BYTES / sizeof(uint64_t);
+	if (settings->iterations > max_iterations)
+		die("Histogram colouring supports at most %zu iterations.\n", max_iterations);
+
+	/* back the iteration buffer with an unlinked temporary file so the kernel
+	 * can page finished bands out instead of holding the whole image in memory */
+	const size_t iters_size = (size_t)settings->width * settings->height * sizeof(uint32_t);
+
+	/* tmpfile() always uses /tmp, which may be a tmpfs, so use $TMPDIR or the outfile's directory */
+	const char* dir = getenv("TMPDIR");
+	size_t dir_len = dir == NULL ? 0 : strlen(dir);
+	if (dir_len == 0) {
+		const char* slash = strrchr(outfile, '/');
+		if (slash != NULL) {
+			dir = outfile;
+			dir_len = slash == outfile ? 1 : (size_t)(slash - outfile);
+		} else {
+			dir = ".";
+			dir_len = 1;
+		}
+	}
+
+	char template[dir_len + sizeof("/f2r-iters-XXXXXX")];
+	sprintf(template, "%.*s/f2r-iters-XXXXXX", (int)dir_len, dir);
+
+	hist->backing = mkstemp(template);
+	if (hist->backing < 0)
+		die("Failed to create the histogram iteration buffer in \"%.*s\".\n", (int)dir_len, dir);
+	unlink(template);
+
+	if (ftruncate(hist->backing, iters_size))
+		die("Failed to size the histogram iteration buffer.\n");
+
+	hist->iters = mmap(NULL, iters_size, PROT_READ | PROT_WRITE, MAP_SHARED, hist->backing, 0);
+	if (hist->iters == MAP_FAILED)
+		die("Failed to map the histogram iteration buffer.\n");
+
+	/* give each thread its own histogram unless that would use too much memory */
+	const size_t hist_size = settings->iterations * sizeof(uint64_t);
+	hist->nhists = hist_size == 0 ? nthreads : min(nthreads, HISTOGRAM_MAX_BYTES / hist_size);
+	if (hist->nhists < nthreads && settings->verbose) {
+		fprintf(stderr, "[histogram]\tsharing %u histograms between %u threads\n", hist->nhists, nthreads);
+	}
+
+	hist->bins = calloc((size_t)hist->nhists * settings->iterations, sizeof(_Atomic(uint64_t)));
+	hist->slice_totals = calloc(nthreads, sizeof(uint64_t));
+	if (hist->bins == NULL || hist->slice_totals == NULL)
+		die("Failed to allocate the histograms.\n");
+
+	hist->nthreads = nthreads;
+	atomic_init(&hist->next_row, 0);
+
+	if (pthread_barrier_init(&hist->barrier, NULL, nthreads))
+		die("Failed to create the histogram barrier.\n");
+}
+
+static void histogram_free(struct histogram* hist, const struct settings* settings) {
+	munmap(hist->iters, (size_t)settings->width * settings->height * sizeof(uint32_t));
+	close(hist->backing);
+	free(hist->bins);
+	free(hist->slice_totals);
+	pthread_barrier_destroy(&hist->barrier);
+}
+
+static void histogram_pass(const struct renderer_arg* rarg) {
+	/*
+	 * first pass of histogram colouring, run by every renderer thread:
+	 * store the iteration count of each pixel and count them into this
+	 * thread's histogram, then merge the histograms and turn the result
+	 * into a cumulative distribution with a parallel prefix sum.
+	 */
+	const struct settings* const settings = rarg->targ->settings;
+	struct histogram* const hist = rarg->targ->histogram;
+	const uint64_t nbins = settings->iterations;
+	_Atomic(uint64_t)* const bins = &hist->bins[(rarg->id % hist->nhists) * nbins];
+	const bool shared = hist->nhists < hist->nthreads;
+	struct thread_stats* const stats = &rarg->targ->stats[rarg->id];
+	struct timespec row_start;
+
+	uint32_t curr_row = atomic_fetch_add(&hist->next_row, 1);
+	while (curr_row < settings->height) {
+		clock_gettime(CLOCK_MONOTONIC, &row_start);
+		uint64_t row_iterations = 0;
+		uint32_t* iters = &hist->iters[(size_t)curr_row * settings->width];
+
+		for (uint32_t x = 0; x < settings->width; x++) {
+			const uint32_t i = iterate(x, curr_row, settings);
+			iters[x] = i;
+			row_iterations += i;
+
+			/* points inside the set are always black so take no part in the histogram */
+			if (i >= nbins) {
+				continue;
+			}
+
+			/* only pay for an atomic increment if another thread counts into these bins */
+			if (shared) {
+				atomic_fetch_add_explicit(&bins[i], 1, memory_order_relaxed);
+			} else {
+				atomic_store_explicit(&bins[i], atomic_load_explicit(&bins[i], memory_order_relaxed) + 1, memory_order_relaxed);
+			}
+		}
+
+		record_row(stats, &stats->counted_rows, row_iterations, &row_start);
+
+		curr_row = atomic_fetch_add(&hist->next_row, 1);
+	}
+
+	pthread_barrier_wait(&hist->barrier);
+
+	/* each thread merges its own slice of the bins into the first histogram */
+	const uint64_t start = nbins * rarg->id / hist->nthreads;
+	const uint64_t end = nbins * (rarg->id + 1) / hist->nthreads;
+	uint64_t total = 0;
+
+	for (uint64_t b = start; b < end; b++) {
+		uint64_t count = atomic_load_explicit(&hist->bins[b], memory_order_relaxed);
+		for (uint32_t h = 1; h < hist->nhists; h++) {
+			count += atomic_load_explicit(&hist->bins[h * nbins + b], memory_order_relaxed);
+		}
+
+		/* and computes the prefix sum local to the slice */
+		total += count;
+		atomic_store_explicit(&hist->bins[b], total, memory_order_relaxed);
+	}
+
+	hist->slice_totals[rarg->id] = total;
+
+	pthread_barrier_wait(&hist->barrier);
+
+	/* offset the slice by the totals of all the slices before it */
+	uint64_t offset = 0;
+	for (uint32_t t = 0; t < rarg->id; t++) {
+		offset += hist->slice_totals[t];
+	}
+
+	for (uint64_t b = start; b < end; b++) {
+		atomic_store_explicit(&hist->bins[b], atomic_load_explicit(&hist->bins[b], memory_order_relaxed) + offset, memory_order_relaxed);
+	}
+
+	pthread_barrier_wait(&hist->barrier);
+}
+
+static void* stats_thread(void* varg) {
+	const struct stats_arg* arg = (struct stats_arg*)varg;
+	const uint64_t interval_ns = arg->interval * 1e9;
+
+	/* sleep in short steps so we notice the render finishing promptly */
+	const struct timespec step = { .tv_sec = 0, .tv_nsec = 100000000 };
+	uint64_t next_report = interval_ns;
+
+	while (!atomic_load(&arg->done)) {
+		nanosleep(&step, NULL);
+		if (elapsed_ns(&arg->start) >= next_report) {
+			write_stats(arg);
+			next_report += interval_ns;
+		}
+	}
+
+	/* always report the final state of the render */
+	write_stats(arg);
+	if (arg->progress)
+		fputc('\n', stderr);
+
+	return NULL;
+}
+
+static void write_stats(const struct stats_arg* arg) {
+	const struct thread_arg* targ = arg->targ;
+	const struct settings* settings = targ->settings;
+	const double elapsed = elapsed_ns(&arg->start) / 1e9;
+
+	const uint64_t rows_total = settings->height;
+	uint64_t rows_done = 0, counted_rows = 0, iterations_done = 0;
+	double utilisation[arg->nthreads];
+
+	for (uint32_t i = 0; i < arg->nthreads; i++) {
+		rows_done += atomic_load_explicit(&targ->stats[i].rows, memory_order_relaxed);
+		counted_rows += atomic_load_explicit(&targ->stats[i].counted_rows, memory_order_relaxed);
+		iterations_done += atomic_load_explicit(&targ->stats[i].iterations, memory_order_relaxed);
+		utilisation[i] = elapsed > 0 ? atomic_load_explicit(&targ->stats[i].busy_ns, memory_order_relaxed) / 1e9 / elapsed : 0;
+	}
+
+	const uint32_t backlog = atomic_load(targ->rows_to_write);
+	const double iterations_per_second = elapsed > 0 ? iterations_done / elapsed : 0;
+
+	/*
+	 * histogram colouring first counts the iterations of every row then colours
+	 * them from the stored counts. The second pass is only colourmap lookups,
+	 * so the ETA follows the first pass and treats the second as free.
+	 */
+	const uint32_t passes = settings->histogram ? 2 : 1;
+	const uint32_t pass = settings->histogram && counted_rows == rows_total ? 2 : 1;
+	const uint64_t pass_rows = pass == 1 && settings->histogram ? counted_rows : rows_done;
+	const uint64_t work_rows = settings->histogram ? counted_rows : rows_done;
+	const double eta = work_rows > 0 ? elapsed * (rows_total - work_rows) / work_rows : -1;
+
+	if (arg->statsfile != NULL) {
+		/* write to a temporary file and rename it over the old stats so readers never see a partial file */
+		char tmpname[strlen(arg->statsfile) + sizeof(".tmp")];
+		sprintf(tmpname, "%s.tmp", arg->statsfile);
+
+		FILE* fp = fopen(tmpname, "w");
+		if (fp == NULL) {
+			fprintf(stderr, "Failed to open statsfile: \"%s\"\n", tmpname);
+		} else {
+			fprintf(fp, "{\"elapsed\":%.3f,\"pass\":%u,\"passes\":%u,", elapsed, pass, passes);
+			fprintf(fp, "\"rows_done\":%lu,\"rows_total\":%lu,", pass_rows, rows_total);
+			fprintf(fp, "\"iterations_per_second\":%.0f,\"writer_backlog\":%u,\"eta\":%.3f,", iterations_per_second, backlog, eta);
+			fputs("\"thread_utilisation\":[", fp);
+			for (uint32_t i = 0; i < arg->nthreads; i++) {
+				fprintf(fp, "%s%.3f", i ? "," : "", utilisation[i]);
+			}
+			fputs("]}\n", fp);
+			fclose(fp);
+
+			if (rename(tmpname, arg->statsfile))
+				fprintf(stderr, "Failed to update statsfile: \"%s\"\n", arg->statsfile);
+		}
+	}
+
+	if (arg->progress) {
+		fprintf(stderr, "\r[stats]\t\tpass %u/%u  %5.1f%%  %.3g it/s  backlog %u  eta %.0fs ",
+			pass, passes, 100.0 * pass_rows / rows_total, iterations_per_second, backlog, eta < 0 ? 0 : eta);
+	}
+}
+
+static uint64_t elapsed_ns(const struct timespec* start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000000000ull + now.tv_nsec - start->tv_nsec;
+}
+
+static inline void record_row(struct thread_stats* stats, _Atomic(uint64_t)* rows, const uint64_t iterations, const struct timespec* row_start) {
+	/* only this thread ever writes these counters so a relaxed load and store is enough */
+	atomic_store_explicit(rows, atomic_load_explicit(rows, memory_order_relaxed) + 1, memory_order_relaxed);
+	atomic_store_explicit(&stats->iterations, atomic_load_explicit(&stats->iterations, memory_order_relaxed) + iterations, memory_order_relaxed);
+	atomic_store_explicit(&stats->busy_ns, atomic_load_explicit(&stats->busy_ns, memory_order_relaxed) + elapsed_ns(row_start), memory_order_relaxed);
+}
+
+static void* async_writer_thread(void* varg) {
+	/*
+	 * writes the image by copying rows in order into large aligned buffers
+	 * which are written out asynchronously by the selected engine
+	 */
+	const struct writer_arg* arg = (struct writer_arg*)varg;
+	const struct thread_arg* targ = arg->targ;
+	const struct settings* settings = targ->settings;
+
+	struct write_engine engine;
+	engine_init(&engine, arg->engine, arg->fd);
+	if (settings->verbose) {
+		fprintf(stderr, "[writer]\t\tusing %s\n", engine.kind == IoUring ? "io_uring" : "pwritev");
+	}
+
+	const struct ff_header header = {
+		.magic = "farbfeld",
+		.width = htonl(settings->width),
+		.height = htonl(settings->height)
+	};
+
+	const size_t row_size = settings->width * sizeof(Pixel);
+	_Atomic(Pixel*)* rows = targ->rows;
+
+	/* the buffer being filled and how much of it is used */
+	uint32_t curr = engine_acquire(&engine);
+	size_t used = sizeof(struct ff_header);
+	off_t offset = 0;
+	memcpy(engine.buffers[curr].data, &header, sizeof(struct ff_header));
+
+	for (uint32_t y = 0; y < settings->height; y++) {
+		/* rows are copied in order so wait for the next one, noting finished writes meanwhile */
+		while (atomic_load(&targ->row_states[y]) != Created)
+			engine_poll(&engine);
+
+		const char* row = (const char*)atomic_load(&rows[y]);
+		size_t copied = 0;
+
+		/* a row may be split over several buffers */
+		while (copied < row_size) {
+			const size_t n = (row_size - copied < WRITE_CHUNK - used) ? row_size - copied : WRITE_CHUNK - used;
+			memcpy(engine.buffers[curr].data + used, row + copied, n);
+			copied += n;
+			used += n;
+
+			if (used == WRITE_CHUNK) {
+				engine.buffers[curr].offset = offset;
+				engine.buffers[curr].iov.iov_len = WRITE_CHUNK;
+				engine_submit(&engine, curr);
+				offset += WRITE_CHUNK;
+				curr = engine_acquire(&engine);
+				used = 0;
+			}
+		}
+
+		atomic_store(&targ->row_states[y], Written);
+		atomic_fetch_sub(targ->rows_to_write, 1);
+		free((void*)row);
+	}
+
+	/* write out the last partial buffer, O_DIRECT needs it padded to the alignment */
+	const off_t file_size = offset + used;
+	if (used > 0) {
+		size_t len = used;
+		if (arg->direct) {
+			len = (used + DIRECT_ALIGN - 1) / DIRECT_ALIGN * DIRECT_ALIGN;
+			memset(engine.buffers[curr].data + used, 0, len - used);
+		}
+
+		engine.buffers[curr].offset = offset;
+		engine.buffers[curr].iov.iov_len = len;
+		engine_submit(&engine, curr);
+	}
+
+	engine_drain(&engine);
+
+	/* remove the padding */
+	if (arg->direct && ftruncate(arg->fd, file_size))
+		die("Failed to truncate outfile: %s\n", strerror(errno));
+
+	/* only time spent writing counts towards the bandwidth, not waiting for rows */
+	if (settings->verbose) {
+		const double io_time = engine.io_ns / 1e9;
+		fprintf(stderr, "[writer]\t\twrote %.1f MB in %.3fs of I/O at %.1f MB/s\n",
+			file_size / 1e6, io_time, io_time > 0 ? file_size / 1e6 / io_time : 0);
+	}
+
+	/* free the space used to store the pointers to the rows */
+	free(rows);
+	free(targ->row_states);
+
+	return NULL;
+}
+
+static void engine_init(struct write_engine* engine, const enum Engine kind, const int fd) {
+	engine->kind = kind;
+	engine->fd = fd;
+	engine->io_ns = 0;
+	engine->inflight = 0;
+
+	for (uint32_t i = 0; i < WRITE_BUFFERS; i++) {
+		engine->buffers[i].data = aligned_alloc(DIRECT_ALIGN, WRITE_CHUNK);
+		if (engine->buffers[i].data == NULL)
+			die("Failed to allocate write buffers\n");
+		engine->buffers[i].iov.iov_base = engine->buffers[i].data;
+		engine->buffers[i].busy = false;
+	}
+
+	/* fall back to pwritev if the kernel doesn't support io_uring or it is disabled */
+	if (engine->kind == IoUring && !uring_init(&engine->ring, WRITE_BUFFERS)) {
+		engine->kind = Pwritev;
+	}
+
+	if (engine->kind == Pwritev) {
+		engine->queue_head = 0;
+		engine->queue_len = 0;
+		engine->stop = false;
+		pthread_mutex_init(&engine->lock, NULL);
+		pthread_cond_init(&engine->cond, NULL);
+		if (pthread_create(&engine->helper, NULL, pwritev_helper, engine))
+			die("Error creating pwritev helper thread\n");
+	}
+}
+
+static uint32_t engine_acquire(struct write_engine* engine) {
+	/* returns the index of a buffer which isn't being written, waiting for one if needed */
+	if (engine->kind == IoUring) {
+		for (;;) {
+			for (uint32_t i = 0; i < WRITE_BUFFERS; i++) {
+				if (!engine->buffers[i].busy)
+					return i;
+			}
+			uring_reap(engine, true);
+		}
+	}
+
+	pthread_mutex_lock(&engine->lock);
+	for (;;) {
+		for (uint32_t i = 0; i < WRITE_BUFFERS; i++) {
+			if (!engine->buffers[i].busy) {
+				pthread_mutex_unlock(&engine->lock);
+				return i;
+			}
+		}
+		pthread_cond_wait(&engine->cond, &engine->lock);
+	}
+}
+
+static void engine_submit(struct write_engine* engine, const uint32_t idx) {
+	struct write_buffer* buf = &engine->buffers[idx];
+
+	if (engine->kind == IoUring) {
+		struct uring* ring = &engine->ring;
+		buf->busy = true;
+
+		if (engine->inflight++ == 0)
+			clock_gettime(CLOCK_MONOTONIC, &engine->busy_start);
+
+		/* at most WRITE_BUFFERS writes are in flight so the ring can't overflow */
+		const unsigned tail = *ring->sq_tail;
+		const unsigned slot = tail & *ring->sq_mask;
+		struct io_uring_sqe* sqe = &ring->sqes[slot];
+
+		memset(sqe, 0, sizeof(struct io_uring_sqe));
+		sqe->opcode = IORING_OP_WRITEV;
+		sqe->fd = engine->fd;
+		sqe->addr = (uint64_t)(uintptr_t)&buf->iov;
+		sqe->len = 1;
+		sqe->off = buf->offset;
+		sqe->user_data = idx;
+
+		ring->sq_array[slot] = slot;
+		atomic_store_explicit((_Atomic(unsigned)*)ring->sq_tail, tail + 1, memory_order_release);
+
+		if (syscall(__NR_io_uring_enter, ring->fd, 1, 0, 0, NULL, 0) < 0)
+			die("Failed to submit write to io_uring\n");
+		return;
+	}
+
+	pthread_mutex_lock(&engine->lock);
+	buf->busy = true;
+	engine->queue[(engine->queue_head + engine->queue_len) % WRITE_BUFFERS] = idx;
+	engine->queue_len++;
+	pthread_cond_broadcast(&engine->cond);
+	pthread_mutex_unlock(&engine->lock);
+}
+
+static void engine_drain(struct write_engine* engine) {
+	/* waits for all outstanding writes and frees the engine */
+	if (engine->kind == IoUring) {
+		for (uint32_t i = 0; i < WRITE_BUFFERS; i++) {
+			while (engine->buffers[i].busy)
+				uring_reap(engine, true);
+		}
+
+		munmap(engine->ring.sqes, engine->ring.sqes_len);
+		if (engine->ring.cq_ptr != engine->ring.sq_ptr)
+			munmap(engine->ring.cq_ptr, engine->ring.cq_len);
+		munmap(engine->ring.sq_ptr, engine->ring.sq_len);
+		close(engine->ring.fd);
+	} else {
+		pthread_mutex_lock(&engine->lock);
+		engine->stop = true;
+		pthread_cond_broadcast(&engine->cond);
+		pthread_mutex_unlock(&engine->lock);
+
+		if (pthread_join(engine->helper, NULL))
+			die("Failed to join pwritev helper thread\n");
+
+		pthread_mutex_destroy(&engine->lock);
+		pthread_cond_destroy(&engine->cond);
+	}
+
+	for (uint32_t i = 0; i < WRITE_BUFFERS; i++) {
+		free(engine->buffers[i].data);
+	}
+}
+
+static void engine_poll(struct write_engine* engine) {
+	/* notes any finished io_uring writes without blocking, so their time isn't overcounted */
+	if (engine->kind == IoUring && engine->inflight > 0)
+		uring_reap(engine, false);
+}
+
+static bool uring_init(struct uring* ring, const unsigned entries) {
+	/* sets up an io_uring instance, returns false if io_uring can't be used */
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+
+	ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+	if (ring->fd < 0)
+		return false;
+
+	ring->sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	/* newer kernels map both rings with a single mmap */
+	const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+	if (single_mmap) {
+		if (ring->cq_len > ring->sq_len)
+			ring->sq_len = ring->cq_len;
+		ring->cq_len = ring->sq_len;
+	}
+
+	ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ptr == MAP_FAILED) {
+		close(ring->fd);
+		return false;
+	}
+
+	if (single_mmap) {
+		ring->cq_ptr = ring->sq_ptr;
+	} else {
+		ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cq_ptr == MAP_FAILED) {
+			munmap(ring->sq_ptr, ring->sq_len);
+			close(ring->fd);
+			return false;
+		}
+	}
+
+	ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		if (!single_mmap)
+			munmap(ring->cq_ptr, ring->cq_len);
+		munmap(ring->sq_ptr, ring->sq_len);
+		close(ring->fd);
+		return false;
+	}
+
+	ring->sq_tail = (unsigned*)((char*)ring->sq_ptr + params.sq_off.tail);
+	ring->sq_mask = (unsigned*)((char*)ring->sq_ptr + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned*)((char*)ring->sq_ptr + params.sq_off.array);
+	ring->cq_head = (unsigned*)((char*)ring->cq_ptr + params.cq_off.head);
+	ring->cq_tail = (unsigned*)((char*)ring->cq_ptr + params.cq_off.tail);
+	ring->cq_mask = (unsigned*)((char*)ring->cq_ptr + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*)((char*)ring->cq_ptr + params.cq_off.cqes);
+
+	return true;
+}
+
+static void uring_reap(struct write_engine* engine, const bool wait) {
+	/* marks the buffers of completed writes as free, optionally waiting for at least one */
+	struct uring* ring = &engine->ring;
+
+	if (wait && syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0)
+		die("Failed to wait for io_uring completions\n");
+
+	unsigned head = *ring->cq_head;
+	const unsigned tail = atomic_load_explicit((_Atomic(unsigned)*)ring->cq_tail, memory_order_acquire);
+	if (head == tail)
+		return;
+
+	for (; head != tail; head++) {
+		const struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+		struct write_buffer* buf = &engine->buffers[cqe->user_data];
+
+		if (cqe->res < 0 || (size_t)cqe->res != buf->iov.iov_len)
+			die("Failed to write to outfile: %s\n", cqe->res < 0 ? strerror(-cqe->res) : "short write");
+
+		buf->busy = false;
+		engine->inflight--;
+	}
+
+	atomic_store_explicit((_Atomic(unsigned)*)ring->cq_head, head, memory_order_release);
+
+	if (engine->inflight == 0)
+		engine->io_ns += elapsed_ns(&engine->busy_start);
+}
+
+static void* pwritev_helper(void* varg) {
+	/* writes out the queued buffers of a Pwritev engine until told to stop */
+	struct write_engine* engine = (struct write_engine*)varg;
+
+	pthread_mutex_lock(&engine->lock);
+	for (;;) {
+		while (engine->queue_len == 0 && !engine->stop)
+			pthread_cond_wait(&engine->cond, &engine->lock);
+
+		if (engine->queue_len == 0)
+			break;
+
+		const uint32_t idx = engine->queue[engine->queue_head];
+		engine->queue_head = (engine->queue_head + 1) % WRITE_BUFFERS;
+		engine->queue_len--;
+		pthread_mutex_unlock(&engine->lock);
+
+		/* write the buffer without holding the lock */
+		struct write_buffer* buf = &engine->buffers[idx];
+		struct timespec write_start;
+		clock_gettime(CLOCK_MONOTONIC, &write_start);
+		const ssize_t written = pwritev(engine->fd, &buf->iov, 1, buf->offset);
+		if (written < 0)
+			die("Failed to write to outfile: %s\n", strerror(errno));
+		if ((size_t)written != buf->iov.iov_len)
+			die("Failed to write to outfile: short write\n");
+		const uint64_t write_ns = elapsed_ns(&write_start);
+
+		pthread_mutex_lock(&engine->lock);
+		engine->io_ns += write_ns;
+		buf->busy = false;
+		pthread_cond_broadcast(&engine->cond);
+	}
+	pthread_mutex_unlock(&engine->lock);
+
+	return NULL;
+}
+
 // takes a number in 0..n and maps it onto the range [a, b]
 static inline double distribute(const uint32_t i, const uint32_t n, const double a, const double b) {
 	return a + ((double)i / ((double)n / (b - a)));
 }
 
-static inline void colour(const uint32_t x, const uint32_t y, Pixel* pixel, const struct settings* settings) {
+static inline size_t colour(const uint32_t x, const uint32_t y, Pixel* pixel, const struct settings* settings) {
 	/*
 	 * colour the pixel with the values for the coordinate at x+iy
 	 *	z = a + bi, c = c + di
+	 * returns the number of iterations performed
 	 */
 
 	static const Pixel default_pixel = {
@@ -623,6 +1584,53 @@ static inline void colour(const uint32_t x, const uint32_t y, Pixel* pixel, cons
 	} else {
 		memcpy(pixel, &settings->colourmap->colours[i % settings->colourmap->size], sizeof(Pixel));
 	}
+
+	return i;
+}
+
+static inline uint32_t iterate(const uint32_t x, const uint32_t y, const struct settings* settings) {
+	/* returns the number of iterations before the point x+iy escapes */
+	double c = distribute(x, settings->width, settings->bottom_left.x, settings->top_right.x),
+		   d = distribute(y, settings->height, settings->top_right.y, settings->bottom_left.y),
+		   c_x = settings->fractal_type == Julia ? settings->julia_centre.x : c,
+		   c_y = settings->fractal_type == Julia ? settings->julia_centre.y : d,
+		   a = c,
+		   b = d,
+		   a2 = a * a,
+		   b2 = b * b;
+
+	uint32_t i = 0;
+	while ((i < settings->iterations) && ((a2 + b2) < 4)) {
+		i++;
+		b = ((a + a) * b) + c_y;
+		a = a2 - b2 + c_x;
+		a2 = a * a;
+		b2 = b * b;
+	}
+
+	return i;
+}
+
+static inline void colour_histogram(const uint32_t i, Pixel* pixel, const struct histogram* hist, const struct settings* settings) {
+	/* colour the pixel by the fraction of escaping pixels which escaped no later than it */
+	static const Pixel default_pixel = {
+		.red = 0,
+		.green = 0,
+		.blue = 0,
+		.alpha = UINT16_MAX
+	};
+
+	if (i == settings->iterations) {
+		memcpy(pixel, &default_pixel, sizeof(Pixel));
+		return;
+	}
+
+	/* after histogram_pass bins holds the cumulative distribution */
+	const uint64_t total = atomic_load_explicit(&hist->bins[settings->iterations - 1], memory_order_relaxed);
+	const uint64_t below = atomic_load_explicit(&hist->bins[i], memory_order_relaxed);
+	const size_t index = (double)below / total * (settings->colourmap->size - 1);
+
+	memcpy(pixel, &settings->colourmap->colours[index], sizeof(Pixel));
 }
 
 static _Noreturn void die(const char* fmt, ...) {